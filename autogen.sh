@@ -13,6 +13,8 @@ if [ -e Makefile ]; then
 fi
 
 pushd ${source_dir} >/dev/null
+echo "Running libtoolize --copy"
+libtoolize --copy || exit 1
 echo "Running aclocal"
 aclocal || exit 1
 echo "Running autoconf"
@@ -0,0 +1,412 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "delivery.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+#include "irc.h"
+#include "pacer.h"
+#include "preferences.h"
+
+/* A lane that has not been served for this long competes one level higher */
+#define DELIVERY_AGING (5 * G_USEC_PER_SEC)
+/* Bytes a channel may send per round, multiplied by its weight */
+#define DELIVERY_QUANTUM 512
+#define DELIVERY_WEIGHT_MAX 100
+/* Channels with queued messages at any one time */
+#define DELIVERY_CHANNELS_MAX 1024
+/* Beyond these the oldest message of the least urgent lane is dropped */
+#define DELIVERY_QUEUED_MAX 1000
+#define DELIVERY_BYTES_MAX (1024 * 1024)
+/* Seconds between reports of dropped messages */
+#define DELIVERY_DROP_REPORT 10
+
+/* Per channel queues, one for each priority lane */
+struct delivery_channel {
+	gchar *name;
+	guint weight;
+	struct {
+		GQueue messages;
+		gsize deficit;
+	} lanes[PRIORITY_COUNT];
+};
+
+static gboolean delivery_channel_id(const gchar *channel, guint *id);
+static void delivery_channel_release(guint id);
+static guint delivery_channel_weight(const gchar *channel);
+static gint delivery_pick_lane(gint64 now);
+static NotifyMessage *delivery_next(gint lane, guint *id);
+static void delivery_evict(void);
+static void delivery_dropped(void);
+static gboolean delivery_drop_report(gpointer user_data);
+static gboolean delivery_drain(gpointer user_data);
+
+static const struct {
+	const gchar *tag;
+	NotifyPriority priority;
+} priority_tags[] = {
+	{ "crit", PRIORITY_CRITICAL },
+	{ "critical", PRIORITY_CRITICAL },
+	{ "high", PRIORITY_HIGH },
+	{ "warn", PRIORITY_HIGH },
+	{ "warning", PRIORITY_HIGH },
+	{ "normal", PRIORITY_NORMAL },
+	{ "info", PRIORITY_NORMAL },
+	{ "low", PRIORITY_LOW },
+	{ "debug", PRIORITY_LOW }
+};
+
+static struct {
+	/* struct delivery_channel, indexed by channel ID */
+	GArray *channels;
+	/* lower case channel name -> channel ID + 1 */
+	GHashTable *ids;
+	/* IDs released by channels whose queues ran empty */
+	GQueue free_ids;
+	/* IDs of the channels with queued messages, per lane in round robin
+	 * order */
+	GQueue active[PRIORITY_COUNT];
+	/* when each lane was last served or became non-empty */
+	gint64 waiting[PRIORITY_COUNT];
+	/* messages and payload bytes in all queues */
+	guint queued;
+	gsize bytes;
+	/* messages dropped since the last report */
+	guint dropped;
+	guint drop_source;
+	guint drain_source;
+} delivery;
+
+gboolean delivery_parse_priority(const gchar *tag, gsize len,
+		NotifyPriority *priority)
+{
+	for (guint i = 0; i < G_N_ELEMENTS(priority_tags); i++) {
+		if (strlen(priority_tags[i].tag) == len &&
+				g_ascii_strncasecmp(priority_tags[i].tag, tag,
+					len) == 0) {
+			*priority = priority_tags[i].priority;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Intern a channel name, IRC channel names are case insensitive. IDs
+ * only live while the channel has queued messages, so at most
+ * DELIVERY_CHANNELS_MAX names are kept */
+static gboolean delivery_channel_id(const gchar *channel, guint *id)
+{
+	struct delivery_channel *c;
+	gchar *key;
+	guint value;
+
+	if (!delivery.channels) {
+		delivery.channels = g_array_new(FALSE, TRUE,
+				sizeof(struct delivery_channel));
+		delivery.ids = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, NULL);
+	}
+
+	key = g_ascii_strdown(channel, -1);
+	value = GPOINTER_TO_UINT(g_hash_table_lookup(delivery.ids, key));
+	if (value > 0) {
+		g_free(key);
+		*id = value - 1;
+		return TRUE;
+	}
+
+	if (!g_queue_is_empty(&delivery.free_ids)) {
+		*id = GPOINTER_TO_UINT(g_queue_pop_head(&delivery.free_ids));
+	} else if (delivery.channels->len < DELIVERY_CHANNELS_MAX) {
+		*id = delivery.channels->len;
+		g_array_set_size(delivery.channels, *id + 1);
+	} else {
+		g_free(key);
+		return FALSE;
+	}
+
+	c = &g_array_index(delivery.channels, struct delivery_channel, *id);
+	memset(c, 0, sizeof(*c));
+	c->name = g_strdup(channel);
+	c->weight = delivery_channel_weight(channel);
+
+	g_hash_table_insert(delivery.ids, key, GUINT_TO_POINTER(*id + 1));
+	return TRUE;
+}
+
+/* Forget a channel once all of its lanes are empty */
+static void delivery_channel_release(guint id)
+{
+	struct delivery_channel *c;
+	gchar *key;
+
+	c = &g_array_index(delivery.channels, struct delivery_channel, id);
+	for (guint i = 0; i < PRIORITY_COUNT; i++)
+		if (!g_queue_is_empty(&c->lanes[i].messages))
+			return;
+
+	key = g_ascii_strdown(c->name, -1);
+	g_hash_table_remove(delivery.ids, key);
+	g_free(key);
+	g_free(c->name);
+	c->name = NULL;
+
+	g_queue_push_tail(&delivery.free_ids, GUINT_TO_POINTER(id));
+}
+
+/* Look the channel up in the -w options, "#channel=weight" */
+static guint delivery_channel_weight(const gchar *channel)
+{
+	gsize len = strlen(channel);
+	guint64 weight;
+
+	for (guint i = 0; prefs.channel_weights && prefs.channel_weights[i];
+			i++) {
+		const gchar *option = prefs.channel_weights[i];
+
+		if (g_ascii_strncasecmp(option, channel, len) != 0 ||
+				option[len] != '=')
+			continue;
+
+		weight = g_ascii_strtoull(&option[len + 1], NULL, 10);
+		return CLAMP(weight, 1, DELIVERY_WEIGHT_MAX);
+	}
+
+	return 1;
+}
+
+/* Queue a message and make sure the queues get drained */
+void delivery_push(const gchar *channel, NotifyMessage *msg,
+		NotifyPriority priority)
+{
+	struct delivery_channel *c;
+	guint id;
+
+	if (!delivery_channel_id(channel, &id)) {
+		delivery_dropped();
+		return;
+	}
+	c = &g_array_index(delivery.channels, struct delivery_channel, id);
+
+	/* a channel becoming active starts with a full quantum so it does
+	 * not wait a whole round */
+	if (g_queue_is_empty(&c->lanes[priority].messages)) {
+		if (g_queue_is_empty(&delivery.active[priority]))
+			delivery.waiting[priority] = g_get_monotonic_time();
+		g_queue_push_tail(&delivery.active[priority],
+				GUINT_TO_POINTER(id));
+		c->lanes[priority].deficit = DELIVERY_QUANTUM * c->weight;
+	}
+	g_queue_push_tail(&c->lanes[priority].messages, message_ref(msg));
+	delivery.queued++;
+	delivery.bytes += msg->len;
+
+	while (delivery.queued > DELIVERY_QUEUED_MAX ||
+			delivery.bytes > DELIVERY_BYTES_MAX)
+		delivery_evict();
+
+	delivery_resume();
+}
+
+/* Start draining the queues if IRC is ready */
+void delivery_resume(void)
+{
+	if (delivery.drain_source == 0 && delivery.queued > 0 &&
+			irc_connected())
+		delivery.drain_source = g_idle_add(delivery_drain, NULL);
+}
+
+/* Strict priority with aging: every DELIVERY_AGING a non-empty lane waits
+ * without being served raises it by one level, ties go to the more urgent
+ * lane */
+static gint delivery_pick_lane(gint64 now)
+{
+	gint64 level, best_level = 0;
+	gint best = -1;
+
+	for (gint i = 0; i < PRIORITY_COUNT; i++) {
+		if (g_queue_is_empty(&delivery.active[i]))
+			continue;
+
+		level = i - (now - delivery.waiting[i]) / DELIVERY_AGING;
+		if (best < 0 || level < best_level) {
+			best = i;
+			best_level = level;
+		}
+	}
+
+	return best;
+}
+
+/* Deficit round robin between the channels of a lane: the channel at the
+ * head sends while its deficit covers the next message, otherwise it gets
+ * another quantum and moves to the back */
+static NotifyMessage *delivery_next(gint lane, guint *id)
+{
+	GQueue *active = &delivery.active[lane];
+	struct delivery_channel *channel;
+	NotifyMessage *msg;
+	gsize size;
+
+	for (;;) {
+		*id = GPOINTER_TO_UINT(g_queue_peek_head(active));
+		channel = &g_array_index(delivery.channels,
+				struct delivery_channel, *id);
+		msg = g_queue_peek_head(&channel->lanes[lane].messages);
+		size = strlen(channel->name) + msg->len;
+
+		if (channel->lanes[lane].deficit >= size)
+			break;
+
+		channel->lanes[lane].deficit += DELIVERY_QUANTUM *
+			channel->weight;
+		g_queue_push_tail(active, g_queue_pop_head(active));
+	}
+
+	channel->lanes[lane].deficit -= size;
+	g_queue_pop_head(&channel->lanes[lane].messages);
+	delivery.queued--;
+	delivery.bytes -= msg->len;
+	if (g_queue_is_empty(&channel->lanes[lane].messages)) {
+		channel->lanes[lane].deficit = 0;
+		g_queue_pop_head(active);
+	}
+
+	return msg;
+}
+
+/* Drop the oldest message of the least urgent non-empty lane */
+static void delivery_evict(void)
+{
+	struct delivery_channel *c, *oldest = NULL;
+	NotifyMessage *msg = NULL, *head;
+	GList *link, *oldest_link = NULL;
+	gint lane = PRIORITY_COUNT - 1;
+
+	while (g_queue_is_empty(&delivery.active[lane]))
+		lane--;
+
+	for (link = delivery.active[lane].head; link; link = link->next) {
+		c = &g_array_index(delivery.channels, struct delivery_channel,
+				GPOINTER_TO_UINT(link->data));
+		head = g_queue_peek_head(&c->lanes[lane].messages);
+		if (!oldest || head->received < msg->received) {
+			oldest = c;
+			oldest_link = link;
+			msg = head;
+		}
+	}
+
+	g_queue_pop_head(&oldest->lanes[lane].messages);
+	delivery.queued--;
+	delivery.bytes -= msg->len;
+	message_unref(msg);
+	delivery_dropped();
+
+	if (g_queue_is_empty(&oldest->lanes[lane].messages)) {
+		oldest->lanes[lane].deficit = 0;
+		delivery_channel_release(GPOINTER_TO_UINT(oldest_link->data));
+		g_queue_delete_link(&delivery.active[lane], oldest_link);
+	}
+}
+
+/* Count a dropped message, reported once every DELIVERY_DROP_REPORT
+ * seconds instead of once per message */
+static void delivery_dropped(void)
+{
+	if (delivery.dropped++ == 0)
+		delivery.drop_source = g_timeout_add_seconds(
+				DELIVERY_DROP_REPORT, delivery_drop_report,
+				NULL);
+}
+
+static gboolean delivery_drop_report(G_GNUC_UNUSED gpointer user_data)
+{
+	g_warning("Delivery queue full, dropped %u messages",
+			delivery.dropped);
+	delivery.dropped = 0;
+	delivery.drop_source = 0;
+	return FALSE;
+}
+
+/* Forward queued messages to IRC in scheduling order, as fast as the
+ * pacer allows, and wait while IRC is not connected */
+static gboolean delivery_drain(G_GNUC_UNUSED gpointer user_data)
+{
+	struct delivery_channel *c;
+	NotifyMessage *msg;
+	gint64 now, delay;
+	gint lane;
+	guint id;
+
+	now = g_get_monotonic_time();
+	while (irc_connected() && (lane = delivery_pick_lane(now)) >= 0) {
+		delay = pacer_reserve(now);
+		if (delay > 0) {
+			delivery.drain_source = g_timeout_add(
+					delay / 1000 + 1, delivery_drain, NULL);
+			return FALSE;
+		}
+
+		msg = delivery_next(lane, &id);
+		delivery.waiting[lane] = now;
+
+		c = &g_array_index(delivery.channels, struct delivery_channel,
+				id);
+		irc_send(c->name, msg);
+		message_unref(msg);
+		delivery_channel_release(id);
+	}
+
+	delivery.drain_source = 0;
+	return FALSE;
+}
+
+void delivery_cleanup(void)
+{
+	struct delivery_channel *c;
+	NotifyMessage *msg;
+
+	if (delivery.drain_source > 0) {
+		g_source_remove(delivery.drain_source);
+		delivery.drain_source = 0;
+	}
+	if (delivery.drop_source > 0) {
+		g_source_remove(delivery.drop_source);
+		delivery.drop_source = 0;
+	}
+	delivery.queued = 0;
+	delivery.bytes = 0;
+	delivery.dropped = 0;
+
+	for (guint i = 0; i < PRIORITY_COUNT; i++)
+		g_queue_clear(&delivery.active[i]);
+	g_queue_clear(&delivery.free_ids);
+
+	if (!delivery.channels)
+		return;
+
+	for (guint id = 0; id < delivery.channels->len; id++) {
+		c = &g_array_index(delivery.channels, struct delivery_channel,
+				id);
+		for (guint i = 0; i < PRIORITY_COUNT; i++)
+			while ((msg = g_queue_pop_head(&c->lanes[i].messages)))
+				message_unref(msg);
+		g_free(c->name);
+	}
+
+	g_array_free(delivery.channels, TRUE);
+	g_hash_table_destroy(delivery.ids);
+	delivery.channels = NULL;
+	delivery.ids = NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __DELIVERY_H__
+#define __DELIVERY_H__
+
+#include <glib.h>
+
+#include "message.h"
+
+/* Message priorities, most urgent first */
+typedef enum {
+	PRIORITY_CRITICAL,
+	PRIORITY_HIGH,
+	PRIORITY_NORMAL,
+	PRIORITY_LOW,
+	PRIORITY_COUNT
+} NotifyPriority;
+
+/* Map a priority tag like "crit" or "info" to a priority */
+gboolean	delivery_parse_priority	(const gchar    *tag,
+					 gsize           len,
+					 NotifyPriority *priority);
+
+/* Queue a message for an IRC channel */
+void		delivery_push		(const gchar    *channel,
+					 NotifyMessage  *msg,
+					 NotifyPriority  priority);
+
+/* Start sending queued messages, called once IRC is connected */
+void		delivery_resume		(void);
+
+/* Drop all queued messages */
+void		delivery_cleanup	(void);
+
+#endif /* __DELIVERY_H__ */
@@ -14,18 +14,35 @@
 
 #include <string.h>
 
+#include "delivery.h"
+#include "message.h"
 #include "notifyserv.h"
+#include "pacer.h"
 #include "preferences.h"
+#include "probes.h"
 
 #define IRC_MAX 512
+/* Seconds to wait before reconnecting */
+#define IRC_RECONNECT_DELAY 30
+/* Seconds between lag measurements */
+#define IRC_LAG_INTERVAL 15
+#define IRC_LAG_TOKEN "LAG"
+/* Lag pings without a reply for this many intervals are given up */
+#define IRC_LAG_TIMEOUT 4
 
 static void irc_write(const gchar *fmt, ...);
+static gboolean irc_writev(GOutputVector *vectors, guint n);
+static gboolean irc_privmsg(const gchar *channel, const gchar *text,
+		gsize len);
 static void irc_connect_cb(GSocketClient *client, GAsyncResult *result,
 		gpointer user_data);
 static void irc_schedule_reconnect(void);
+static void irc_disconnect(void);
 static void irc_source_attach(void);
 static gboolean irc_callback(gpointer user_data);
 static void irc_parse(const gchar *line);
+static gboolean irc_lag_ping(gpointer user_data);
+static void irc_lag_pong(const gchar *token);
 
 static struct {
 	GSocketConnection *connection;
@@ -33,6 +50,12 @@ static struct {
 	GInputStream *istream;
 	GSource *callback_source;
 	guint reconnect_source;
+	guint lag_source;
+	gint64 lag_sent;
+	/* the server accepted our registration and channels were joined */
+	gboolean registered;
+	/* input after the last complete line */
+	GString *pending;
 } irc;
 
 /* Send data to the IRC socket after terminating it with \r\n */
@@ -56,27 +79,93 @@ static void irc_write(const gchar *fmt, ...)
 				NULL, &error) < 0) {
 		g_warning("Failed to write: %s", error->message);
 		g_error_free(error);
+	} else {
+		PROBE2(irc_write, tmp2, strlen(tmp2));
 	}
 
 	g_free(tmp2);
 }
 
-/* Prepend 'PRIVMSG chan :' and send that to irc_write */
-void irc_say(const gchar *channel, const gchar *fmt, ...)
+/* Send a set of buffers with a single sendmsg(), resuming partial writes */
+static gboolean irc_writev(GOutputVector *vectors, guint n)
 {
-	if (irc.ostream) {
-		va_list ap;
-		gchar *tmp;
+	GError *error = NULL;
+	GSocket *socket;
+	gsize written = 0;
+	gssize sent;
+
+	socket = g_socket_connection_get_socket(irc.connection);
+	while (n > 0) {
+		sent = g_socket_send_message(socket, NULL, vectors, n, NULL, 0,
+				0, NULL, &error);
+		if (sent < 0) {
+			g_warning("Failed to write: %s", error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		written += sent;
 
-		va_start(ap, fmt);
-		tmp = g_strdup_vprintf(fmt, ap);
-		va_end(ap);
+		/* skip the vectors that were written completely */
+		while (n > 0 && (gsize) sent >= vectors->size) {
+			sent -= vectors->size;
+			vectors++;
+			n--;
+		}
+		if (n > 0) {
+			vectors->buffer = (const gchar *) vectors->buffer + sent;
+			vectors->size -= sent;
+		}
+	}
 
-		irc_write("PRIVMSG %s :%s", channel, tmp);
-		g_free(tmp);
-	} else {
+	PROBE1(irc_writev, written);
+	return TRUE;
+}
+
+/* Send 'PRIVMSG chan :text', the text is passed to the socket as is */
+static gboolean irc_privmsg(const gchar *channel, const gchar *text,
+		gsize len)
+{
+	GOutputVector vectors[] = {
+		{ "PRIVMSG ", 8 },
+		{ channel, strlen(channel) },
+		{ " :", 2 },
+		{ text, len },
+		{ "\n", 1 }
+	};
+
+	if (!irc.ostream) {
 		g_warning("Cannot write to IRC: not connected");
+		return FALSE;
 	}
+
+	return irc_writev(vectors, G_N_ELEMENTS(vectors));
+}
+
+/* Format the text and send it to an IRC channel */
+void irc_say(const gchar *channel, const gchar *fmt, ...)
+{
+	va_list ap;
+	gchar *tmp;
+
+	va_start(ap, fmt);
+	tmp = g_strdup_vprintf(fmt, ap);
+	va_end(ap);
+
+	irc_privmsg(channel, tmp, strlen(tmp));
+	g_free(tmp);
+}
+
+/* Whether messages can be sent to channels */
+gboolean irc_connected(void)
+{
+	return irc.ostream && irc.registered;
+}
+
+/* Send a message to an IRC channel without copying its payload */
+void irc_send(const gchar *channel, NotifyMessage *msg)
+{
+	if (irc_privmsg(channel, msg->data, msg->len))
+		PROBE3(message_sent, channel, msg->len, msg->received);
 }
 
 /* Connect to the IRC server */
@@ -120,6 +209,11 @@ static void irc_connect_cb(GSocketClient *client, GAsyncResult *result,
 	irc_write("USER %s 0 * :" PACKAGE_STRING, prefs.irc_ident);
 	irc_write("NICK %s", prefs.irc_nick);
 
+	pacer_reset();
+	if (irc.pending)
+		g_string_truncate(irc.pending, 0);
+	else
+		irc.pending = g_string_sized_new(IRC_MAX);
 	irc_source_attach();
 }
 
@@ -128,6 +222,8 @@ static void irc_parse(const gchar *line)
 {
 	gchar *tmp;
 
+	PROBE1(irc_line, line);
+
 	if (strncmp(line, "ERROR :", 7) == 0) {
 		if (strstr(line, "Connection timed out")) {
 			irc_schedule_reconnect();
@@ -150,6 +246,15 @@ static void irc_parse(const gchar *line)
 	}
 	g_free(tmp);
 
+	/* ":server PONG server :LAG<timestamp>" */
+	tmp = strchr(line, ' ');
+	if (line[0] == ':' && tmp && strncmp(tmp, " PONG ", 6) == 0) {
+		tmp = strstr(tmp, " :" IRC_LAG_TOKEN);
+		if (tmp)
+			irc_lag_pong(&tmp[2 + strlen(IRC_LAG_TOKEN)]);
+		return;
+	}
+
 	if (strncmp(line, "PING :", 6) == 0)
 	{
 		g_debug("[IRC] Sending PONG :%s", &line[6]);
@@ -166,6 +271,13 @@ static void irc_parse(const gchar *line)
 			g_message("[IRC] Joining %s.", prefs.irc_chans[i]);
 			irc_write("JOIN %s", prefs.irc_chans[i]);
 		}
+
+		if (irc.lag_source == 0)
+			irc.lag_source = g_timeout_add_seconds(
+					IRC_LAG_INTERVAL, irc_lag_ping, NULL);
+
+		irc.registered = TRUE;
+		delivery_resume();
 	}
 	g_free(tmp);
 
@@ -232,9 +344,72 @@ static void irc_parse(const gchar *line)
 	}
 }
 
+/* Send a timestamped PING, the server echoes the token in its PONG */
+static gboolean irc_lag_ping(G_GNUC_UNUSED gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time();
+
+	/* a ping that is still unanswered is a lower bound for the lag,
+	 * until it is given up as lost and replaced by a new one */
+	if (irc.lag_sent > 0) {
+		pacer_update_lag(now - irc.lag_sent);
+		if (now - irc.lag_sent < IRC_LAG_TIMEOUT * IRC_LAG_INTERVAL *
+				G_USEC_PER_SEC)
+			return TRUE;
+		g_debug("[IRC] Lag ping timed out, sending a new one");
+	}
+
+	irc.lag_sent = now;
+	irc_write("PING :" IRC_LAG_TOKEN "%" G_GINT64_FORMAT, now);
+
+	return TRUE;
+}
+
+static void irc_lag_pong(const gchar *token)
+{
+	gint64 sent = g_ascii_strtoll(token, NULL, 10);
+
+	/* ignore replies to pings from an earlier connection */
+	if (sent != irc.lag_sent || sent == 0)
+		return;
+
+	irc.lag_sent = 0;
+	pacer_update_lag(g_get_monotonic_time() - sent);
+}
+
 static void irc_schedule_reconnect(void)
 {
-	irc.reconnect_source = g_timeout_add_seconds(30, irc_connect, NULL);
+	irc_disconnect();
+
+	if (irc.lag_source > 0) {
+		g_source_remove(irc.lag_source);
+		irc.lag_source = 0;
+	}
+	irc.lag_sent = 0;
+
+	PROBE1(reconnect, IRC_RECONNECT_DELAY);
+	irc.reconnect_source = g_timeout_add_seconds(IRC_RECONNECT_DELAY,
+			irc_connect, NULL);
+}
+
+/* Drop the connection, queued messages wait until the next one is
+ * registered */
+static void irc_disconnect(void)
+{
+	if (irc.callback_source) {
+		g_source_destroy(irc.callback_source);
+		g_source_unref(irc.callback_source);
+		irc.callback_source = NULL;
+	}
+
+	if (irc.connection) {
+		g_object_unref(irc.connection);
+		irc.connection = NULL;
+	}
+
+	irc.ostream = NULL;
+	irc.istream = NULL;
+	irc.registered = FALSE;
 }
 
 static void irc_source_attach(void)
@@ -249,24 +424,41 @@ static void irc_source_attach(void)
 static gboolean irc_callback(G_GNUC_UNUSED gpointer user_data)
 {
 	GError *error = NULL;
-	gchar *buf, **lines;
+	gchar buf[IRC_MAX], *line, *end;
+	gsize done = 0;
 	gssize len;
 
-	buf = g_malloc0(IRC_MAX);
 	len = g_input_stream_read(irc.istream, buf, IRC_MAX, NULL, &error);
 	if (len < 0) {
-		g_free(buf);
 		g_warning("Failed to read from IRC: %s", error->message);
 		g_error_free(error);
 		irc_schedule_reconnect();
 		return FALSE;
-	} else if (len > 0) {
-		lines = g_strsplit(buf, "\r\n", 0);
-		for (guint i = 0; lines[i] != NULL; i++)
-			irc_parse(lines[i]);
-		g_strfreev(lines);
 	}
-	g_free(buf);
+	if (len == 0) {
+		g_warning("Connection to IRC closed by the server");
+		irc_schedule_reconnect();
+		return FALSE;
+	}
+
+	PROBE1(irc_read, len);
+
+	/* keep a partial line until the rest of it arrives */
+	g_string_append_len(irc.pending, buf, len);
+	line = irc.pending->str;
+	while ((end = memchr(line, '\n', irc.pending->len - done))) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r')
+			end[-1] = '\0';
+		irc_parse(line);
+		done += end - line + 1;
+		line = end + 1;
+	}
+	g_string_erase(irc.pending, 0, done);
+
+	/* servers never send lines this long, don't buffer garbage */
+	if (irc.pending->len > IRC_MAX)
+		g_string_truncate(irc.pending, 0);
 
 	return TRUE;
 }
@@ -10,6 +10,8 @@
 
 #include <glib.h>
 
+#include "message.h"
+
 /* Connect to IRC */
 gboolean	irc_connect	(gpointer     data);
 
@@ -18,4 +20,11 @@ void		irc_say		(const gchar *channel,
 				 const gchar *fmt,
 				 ...);
 
+/* Whether the connection is registered and messages can be sent */
+gboolean	irc_connected	(void);
+
+/* Send a message to an IRC channel, the message is not copied */
+void		irc_send	(const gchar   *channel,
+				 NotifyMessage *msg);
+
 #endif /* __IRC_H__ */
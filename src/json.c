@@ -0,0 +1,237 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "json.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+/* Nesting limit for skipped values */
+#define JSON_MAX_DEPTH 32
+
+struct json_scanner {
+	gchar *p;
+	gchar *end;
+};
+
+static void json_skip_space(struct json_scanner *s);
+static gboolean json_string(struct json_scanner *s, gchar **value,
+		gsize *len);
+static gint json_hex(const gchar *p);
+static gboolean json_skip_value(struct json_scanner *s, guint depth);
+
+gboolean json_scan(gchar *buf, gsize len, JsonField *fields, guint n_fields)
+{
+	struct json_scanner s = { buf, buf + len };
+	JsonField *field;
+	gchar *name, *value;
+	gsize name_len;
+
+	for (guint i = 0; i < n_fields; i++)
+		fields[i].value = NULL;
+
+	json_skip_space(&s);
+	if (s.p == s.end || *s.p++ != '{')
+		return FALSE;
+
+	json_skip_space(&s);
+	if (s.p < s.end && *s.p == '}') {
+		s.p++;
+	} else for (;;) {
+		if (!json_string(&s, &name, &name_len))
+			return FALSE;
+		json_skip_space(&s);
+		if (s.p == s.end || *s.p++ != ':')
+			return FALSE;
+		json_skip_space(&s);
+
+		field = NULL;
+		for (guint i = 0; i < n_fields; i++) {
+			if (strcmp(fields[i].name, name) == 0) {
+				field = &fields[i];
+				break;
+			}
+		}
+
+		if (field && s.p < s.end && *s.p == '"') {
+			if (!json_string(&s, &value, &field->len))
+				return FALSE;
+			field->value = value;
+			field->string = TRUE;
+		} else {
+			value = s.p;
+			if (!json_skip_value(&s, 0))
+				return FALSE;
+			if (field) {
+				field->value = value;
+				field->len = s.p - value;
+				field->string = FALSE;
+			}
+		}
+
+		json_skip_space(&s);
+		if (s.p == s.end)
+			return FALSE;
+		if (*s.p == '}') {
+			s.p++;
+			break;
+		}
+		if (*s.p++ != ',')
+			return FALSE;
+		json_skip_space(&s);
+	}
+
+	json_skip_space(&s);
+	return s.p == s.end;
+}
+
+static void json_skip_space(struct json_scanner *s)
+{
+	while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' ||
+				*s->p == '\r' || *s->p == '\n'))
+		s->p++;
+}
+
+/* Unescape a string in place, the result is never longer than the input
+ * so it can be written over it and terminated at the end */
+static gboolean json_string(struct json_scanner *s, gchar **value,
+		gsize *len)
+{
+	gchar *out;
+	gunichar c;
+	gint hex;
+
+	if (s->p == s->end || *s->p != '"')
+		return FALSE;
+
+	*value = out = ++s->p;
+	for (;;) {
+		if (s->p == s->end)
+			return FALSE;
+
+		if (*s->p == '"') {
+			s->p++;
+			break;
+		}
+
+		if (*s->p != '\\') {
+			*out++ = *s->p++;
+			continue;
+		}
+
+		if (++s->p == s->end)
+			return FALSE;
+		switch (*s->p++) {
+		case '"': *out++ = '"'; break;
+		case '\\': *out++ = '\\'; break;
+		case '/': *out++ = '/'; break;
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u':
+			if (s->end - s->p < 4 || (hex = json_hex(s->p)) < 0)
+				return FALSE;
+			s->p += 4;
+			c = hex;
+
+			/* surrogate pair */
+			if (c >= 0xd800 && c < 0xdc00 && s->end - s->p >= 6 &&
+					s->p[0] == '\\' && s->p[1] == 'u' &&
+					(hex = json_hex(&s->p[2])) >= 0xdc00 &&
+					hex < 0xe000) {
+				c = 0x10000 + ((c - 0xd800) << 10) +
+					(hex - 0xdc00);
+				s->p += 6;
+			} else if (c >= 0xd800 && c < 0xe000) {
+				c = 0xfffd;
+			}
+
+			out += g_unichar_to_utf8(c, out);
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	*len = out - *value;
+	*out = '\0';
+	return TRUE;
+}
+
+static gint json_hex(const gchar *p)
+{
+	gint value = 0, digit;
+
+	for (guint i = 0; i < 4; i++) {
+		if ((digit = g_ascii_xdigit_value(p[i])) < 0)
+			return -1;
+		value = value << 4 | digit;
+	}
+
+	return value;
+}
+
+/* Skip over any value, the structure of objects and arrays is checked but
+ * their contents are not interpreted */
+static gboolean json_skip_value(struct json_scanner *s, guint depth)
+{
+	gchar *value;
+	gsize len;
+	gchar close;
+
+	if (s->p == s->end || depth > JSON_MAX_DEPTH)
+		return FALSE;
+
+	switch (*s->p) {
+	case '"':
+		return json_string(s, &value, &len);
+	case '{':
+	case '[':
+		close = *s->p == '{' ? '}' : ']';
+		s->p++;
+		json_skip_space(s);
+		if (s->p < s->end && *s->p == close) {
+			s->p++;
+			return TRUE;
+		}
+		for (;;) {
+			if (close == '}') {
+				if (!json_string(s, &value, &len))
+					return FALSE;
+				json_skip_space(s);
+				if (s->p == s->end || *s->p++ != ':')
+					return FALSE;
+				json_skip_space(s);
+			}
+			if (!json_skip_value(s, depth + 1))
+				return FALSE;
+			json_skip_space(s);
+			if (s->p == s->end)
+				return FALSE;
+			if (*s->p == close) {
+				s->p++;
+				return TRUE;
+			}
+			if (*s->p++ != ',')
+				return FALSE;
+			json_skip_space(s);
+		}
+	default:
+		/* numbers and literals */
+		value = s->p;
+		while (s->p < s->end && (g_ascii_isalnum(*s->p) ||
+					*s->p == '-' || *s->p == '+' ||
+					*s->p == '.'))
+			s->p++;
+		return s->p > value;
+	}
+}
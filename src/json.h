@@ -0,0 +1,31 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <glib.h>
+
+/* A top-level member to extract, value is NULL when it is missing */
+typedef struct {
+	const gchar *name;
+	/* points into the scanned buffer, strings are unescaped and NUL
+	 * terminated, other values are not terminated */
+	const gchar *value;
+	gsize len;
+	gboolean string;
+} JsonField;
+
+/* Scan one JSON object without building a tree, only the listed members
+ * are extracted and everything else is skipped. Strings are unescaped in
+ * place, so buf is modified. Returns FALSE on malformed input */
+gboolean	json_scan	(gchar     *buf,
+				 gsize      len,
+				 JsonField *fields,
+				 guint      n_fields);
+
+#endif /* __JSON_H__ */
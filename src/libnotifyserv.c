@@ -0,0 +1,339 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "libnotifyserv.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NOTIFY_PORT 8675
+/* Flush when this many messages are queued or the oldest one is this old */
+#define NOTIFY_BATCH 64
+#define NOTIFY_INTERVAL (50 * G_USEC_PER_SEC / 1000)
+/* notify_send() drops messages beyond this */
+#define NOTIFY_MAX_QUEUED 10000
+/* Bytes kept for retrying while notifyserv cannot be reached */
+#define NOTIFY_MAX_BUFFER (1024 * 1024)
+#define NOTIFY_BACKOFF_MIN (G_USEC_PER_SEC / 10)
+#define NOTIFY_BACKOFF_MAX (10 * G_USEC_PER_SEC)
+/* RFC 2812 channel name length */
+#define NOTIFY_CHANNEL_MAX 50
+
+/* A formatted line, queued on a lock-free stack */
+struct notify_entry {
+	struct notify_entry *next;
+	gsize len;
+	gchar line[];
+};
+
+static gboolean notify_valid_channel(const gchar *channel);
+static gpointer notify_thread(gpointer data);
+static void notify_wakeup(void);
+static gboolean notify_flush(void);
+static gboolean notify_connect(void);
+static void notify_disconnect(void);
+
+static struct {
+	gchar *address;
+	GThread *thread;
+	/* producers push onto head, the writer takes the whole stack */
+	struct notify_entry *head;
+	gint queued;
+	gint closing;
+	gint wakeup[2];
+	/* only used by the writer thread */
+	GSocketConnection *connection;
+	GString *out;
+	gint64 backoff;
+} notify = { NULL, NULL, NULL, 0, 0, { -1, -1 }, NULL, NULL, 0 };
+
+gboolean notifyserv_init(const gchar *address)
+{
+	GError *error = NULL;
+
+	if (notify.thread)
+		return TRUE;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init();
+#endif
+
+	if (pipe(notify.wakeup) < 0) {
+		g_warning("Failed to create wakeup pipe: %s",
+				g_strerror(errno));
+		return FALSE;
+	}
+	fcntl(notify.wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(notify.wakeup[1], F_SETFL, O_NONBLOCK);
+
+	notify.address = g_strdup(address ? address : "localhost");
+	notify.out = g_string_new(NULL);
+	notify.closing = 0;
+
+	notify.thread = g_thread_try_new("notifyserv", notify_thread, NULL,
+			&error);
+	if (!notify.thread) {
+		g_warning("Failed to start writer thread: %s",
+				error->message);
+		g_error_free(error);
+		notifyserv_close();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean notify_send(const gchar *channel, const gchar *text)
+{
+	struct notify_entry *entry, *head;
+	gsize clen, tlen;
+
+	if (!notify.thread || !notify_valid_channel(channel))
+		return FALSE;
+
+	if (g_atomic_int_add(&notify.queued, 1) >= NOTIFY_MAX_QUEUED) {
+		g_atomic_int_add(&notify.queued, -1);
+		return FALSE;
+	}
+
+	/* "<channel> -- <text>\n", the protocol is line based and the "--"
+	 * keeps text that looks like options from being interpreted */
+	clen = strlen(channel);
+	tlen = strlen(text);
+	entry = g_malloc(sizeof(struct notify_entry) + clen + tlen + 5);
+	entry->len = clen + tlen + 5;
+	memcpy(entry->line, channel, clen);
+	memcpy(&entry->line[clen], " -- ", 4);
+	memcpy(&entry->line[clen + 4], text, tlen);
+	for (gchar *p = &entry->line[clen + 4];
+			p < &entry->line[clen + 4 + tlen]; p++)
+		if (*p == '\n' || *p == '\r')
+			*p = ' ';
+	entry->line[entry->len - 1] = '\n';
+
+	do {
+		head = g_atomic_pointer_get(&notify.head);
+		entry->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&notify.head, head,
+				entry));
+
+	/* the writer only needs a nudge to start the batch timer or when
+	 * a batch is full */
+	if (!head || g_atomic_int_get(&notify.queued) == NOTIFY_BATCH)
+		notify_wakeup();
+
+	return TRUE;
+}
+
+void notifyserv_close(void)
+{
+	if (notify.thread) {
+		g_atomic_int_set(&notify.closing, 1);
+		notify_wakeup();
+		g_thread_join(notify.thread);
+		notify.thread = NULL;
+	}
+
+	if (notify.wakeup[0] >= 0)
+		close(notify.wakeup[0]);
+	if (notify.wakeup[1] >= 0)
+		close(notify.wakeup[1]);
+	notify.wakeup[0] = notify.wakeup[1] = -1;
+
+	if (notify.out)
+		g_string_free(notify.out, TRUE);
+	notify.out = NULL;
+	g_free(notify.address);
+	notify.address = NULL;
+}
+
+/* "*" or a channel notifyserv accepts, anything else would change the
+ * meaning of the line */
+static gboolean notify_valid_channel(const gchar *channel)
+{
+	gsize len = strlen(channel);
+
+	if (strcmp(channel, "*") == 0)
+		return TRUE;
+	if (channel[0] != '#' || len < 2 || len > NOTIFY_CHANNEL_MAX)
+		return FALSE;
+
+	for (gsize i = 0; i < len; i++)
+		if ((guchar) channel[i] <= ' ' || channel[i] == ',' ||
+				channel[i] == 0x7f)
+			return FALSE;
+
+	return TRUE;
+}
+
+static void notify_wakeup(void)
+{
+	/* a full pipe already has a wakeup pending */
+	if (write(notify.wakeup[1], "", 1) < 0 && errno != EAGAIN)
+		g_warning("Failed to wake up writer: %s", g_strerror(errno));
+}
+
+/* Writer thread: sleep until a batch is full or the oldest message has
+ * waited long enough, then write everything in one go */
+static gpointer notify_thread(G_GNUC_UNUSED gpointer data)
+{
+	struct pollfd pfd = { notify.wakeup[0], POLLIN, 0 };
+	gint64 now, deadline = 0;
+	gchar buf[64];
+	gint timeout;
+
+	for (;;) {
+		timeout = -1;
+		if (deadline > 0) {
+			now = g_get_monotonic_time();
+			timeout = deadline > now ? (deadline - now) / 1000 : 0;
+		}
+
+		poll(&pfd, 1, timeout);
+		while (read(notify.wakeup[0], buf, sizeof(buf)) > 0)
+			;
+
+		if (g_atomic_int_get(&notify.closing))
+			break;
+
+		now = g_get_monotonic_time();
+		if (!g_atomic_pointer_get(&notify.head) &&
+				notify.out->len == 0) {
+			deadline = 0;
+			continue;
+		}
+
+		if (deadline == 0)
+			deadline = now + NOTIFY_INTERVAL;
+		if (now < deadline &&
+				g_atomic_int_get(&notify.queued) < NOTIFY_BATCH)
+			continue;
+
+		if (notify_flush()) {
+			deadline = 0;
+		} else {
+			/* reconnect with exponential backoff */
+			notify.backoff = CLAMP(notify.backoff * 2,
+					NOTIFY_BACKOFF_MIN, NOTIFY_BACKOFF_MAX);
+			deadline = now + notify.backoff;
+		}
+	}
+
+	notify_flush();
+	notify_disconnect();
+
+	return NULL;
+}
+
+/* Take everything queued and write it, returns FALSE if the data could
+ * not be written and has to be retried */
+static gboolean notify_flush(void)
+{
+	struct notify_entry *head, *entry, *reversed = NULL;
+	GError *error = NULL;
+	GOutputStream *ostream;
+	guint count = 0;
+
+	do {
+		head = g_atomic_pointer_get(&notify.head);
+	} while (head && !g_atomic_pointer_compare_and_exchange(&notify.head,
+				head, NULL));
+
+	/* the stack is newest first */
+	while (head) {
+		entry = head;
+		head = head->next;
+		entry->next = reversed;
+		reversed = entry;
+		count++;
+	}
+	g_atomic_int_add(&notify.queued, -(gint) count);
+
+	while (reversed) {
+		entry = reversed;
+		reversed = reversed->next;
+		if (notify.out->len + entry->len <= NOTIFY_MAX_BUFFER)
+			g_string_append_len(notify.out, entry->line,
+					entry->len);
+		g_free(entry);
+	}
+
+	if (notify.out->len == 0)
+		return TRUE;
+
+	/* notifyserv never sends anything, so a readable socket means it
+	 * closed the connection after it was idle for too long */
+	if (notify.connection && g_socket_condition_check(
+				g_socket_connection_get_socket(
+					notify.connection),
+				G_IO_IN | G_IO_HUP))
+		notify_disconnect();
+
+	if (!notify.connection && !notify_connect())
+		return FALSE;
+
+	ostream = g_io_stream_get_output_stream(
+			G_IO_STREAM(notify.connection));
+	if (!g_output_stream_write_all(ostream, notify.out->str,
+				notify.out->len, NULL, NULL, &error)) {
+		g_warning("Failed to write to notifyserv: %s",
+				error->message);
+		g_error_free(error);
+		notify_disconnect();
+		return FALSE;
+	}
+
+	g_string_truncate(notify.out, 0);
+	notify.backoff = 0;
+	return TRUE;
+}
+
+static gboolean notify_connect(void)
+{
+	GError *error = NULL;
+	GSocketClient *client;
+
+	client = g_socket_client_new();
+	if (strchr(notify.address, '/')) {
+		GSocketAddress *address;
+
+		address = g_unix_socket_address_new(notify.address);
+		notify.connection = g_socket_client_connect(client,
+				G_SOCKET_CONNECTABLE(address), NULL, &error);
+		g_object_unref(address);
+	} else {
+		notify.connection = g_socket_client_connect_to_host(client,
+				notify.address, NOTIFY_PORT, NULL, &error);
+	}
+	g_object_unref(client);
+
+	if (!notify.connection) {
+		g_warning("Failed to connect to notifyserv at %s: %s",
+				notify.address, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void notify_disconnect(void)
+{
+	if (notify.connection) {
+		g_object_unref(notify.connection);
+		notify.connection = NULL;
+	}
+}
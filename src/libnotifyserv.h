@@ -0,0 +1,32 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __LIBNOTIFYSERV_H__
+#define __LIBNOTIFYSERV_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Start the background writer for the notifyserv listening at address,
+ * either the path of a Unix domain socket or host[:port] */
+gboolean	notifyserv_init		(const gchar *address);
+
+/* Queue text for a channel, or for all channels if channel is "*".
+ * The text is sent literally, it is never parsed for input options.
+ * Never blocks on I/O and may be called from any thread; returns FALSE
+ * when the channel is not a valid channel name or the message was
+ * dropped because too many are queued */
+gboolean	notify_send		(const gchar *channel,
+					 const gchar *text);
+
+/* Write out what is still queued and stop the background writer */
+void		notifyserv_close	(void);
+
+G_END_DECLS
+
+#endif /* __LIBNOTIFYSERV_H__ */
@@ -13,25 +13,91 @@
 #include <gio/gio.h>
 #include <gio/gunixsocketaddress.h>
 
+#include <math.h>
 #include <string.h>
 
-#include "irc.h"
+#include "delivery.h"
+#include "json.h"
+#include "message.h"
 #include "preferences.h"
+#include "probes.h"
+#include "tail.h"
+#include "timer.h"
 
-#define BUF_SIZE 1024
+#define BUF_SIZE 16384
+/* Longer lines are forwarded in pieces */
+#define LISTEN_LINE_MAX 4096
+/* JSON events cannot be split, longer ones are dropped */
+#define LISTEN_JSON_MAX 65536
+/* RFC 2812 channel name length */
+#define LISTEN_CHANNEL_MAX 50
+/* Clients are disconnected after this many seconds without input */
+#define LISTEN_IDLE_TIMEOUT 5
+/* Further connections are closed right away */
+#define LISTEN_CLIENTS_MAX 256
+
+struct listen_client {
+	GSocketConnection *connection;
+	GInputStream *istream;
+	GCancellable *cancellable;
+	ListenStream *stream;
+	gchar *buf;
+	guint idle_source;
+};
 
 static gboolean listen_accept(GSocketService *service,
 		GSocketConnection *connection, GObject *src_object,
 		gpointer user_data);
+static void listen_read_cb(GObject *source, GAsyncResult *result,
+		gpointer user_data);
+static gboolean listen_client_idle(gpointer data);
+static void listen_client_free(struct listen_client *client);
+static gboolean listen_stream_json(ListenStream *stream);
+static void listen_stream_line(ListenStream *stream, gchar *line,
+		gsize len);
+static gboolean listen_valid_channel(const gchar *channel);
 static void listen_parse(const gchar *input);
+static void listen_parse_json(gchar *line, gsize len);
+static gboolean listen_parse_delay(const gchar *when, gsize len,
+		gint64 *delay);
+static void listen_forward(const gchar *channel, NotifyPriority priority,
+		gint64 delay, const gchar *key, const gchar *text, gsize len);
+static void listen_deliver(const gchar *channel, NotifyPriority priority,
+		NotifyMessage *msg);
+static void listen_scheduled_fire(gpointer data);
+static void listen_scheduled_free(gpointer data);
+
+/* A message waiting in the timer wheel */
+struct listen_scheduled {
+	gchar *channel;
+	NotifyPriority priority;
+	NotifyMessage *msg;
+};
+
+/* Streams are line based or JSON lines, decided by their first line */
+enum listen_mode {
+	LISTEN_MODE_UNKNOWN,
+	LISTEN_MODE_LINES,
+	LISTEN_MODE_JSON
+};
+
+struct _ListenStream {
+	GString *pending;
+	enum listen_mode mode;
+	/* skipping the rest of an oversized JSON line */
+	gboolean discarding;
+};
 
 static struct {
 	GSocketService *service;
+	guint clients;
 } listen;
 
 /* Start specified listening sockets */
 gboolean start_listener(void)
 {
+	gboolean tailing = FALSE;
+
 	listen.service = g_socket_service_new();
 
 	if (prefs.sock_path) {
@@ -87,9 +153,12 @@ gboolean start_listener(void)
 		g_object_unref(saddress);
 	}
 
-	if (!prefs.sock_path && !prefs.bind_address) {
-		g_critical("No Unix domain socket path defined and TCP sockets"
-				" disabled.");
+	if (prefs.tail_paths)
+		tailing = tail_start();
+
+	if (!prefs.sock_path && !prefs.bind_address && !tailing) {
+		g_critical("No Unix domain socket path defined, no files to"
+				" tail and TCP sockets disabled.");
 		return FALSE;
 	}
 
@@ -99,56 +168,519 @@ gboolean start_listener(void)
 	return TRUE;
 }
 
-/* Parse input from listening sockets */
+/* Start reading from a new client, the connection stays open until the
+ * client closes it or sends nothing for LISTEN_IDLE_TIMEOUT seconds so
+ * producers can keep sending on one connection */
 static gboolean listen_accept(G_GNUC_UNUSED GSocketService *service,
 		GSocketConnection *connection,
 		G_GNUC_UNUSED GObject *src_object,
 		G_GNUC_UNUSED gpointer user_data)
 {
+	struct listen_client *client;
+
+	if (listen.clients >= LISTEN_CLIENTS_MAX) {
+		g_warning("Too many clients, closing new connection");
+		g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+		return TRUE;
+	}
+	listen.clients++;
+
+	client = g_slice_new(struct listen_client);
+	client->connection = g_object_ref(connection);
+	client->istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+	client->cancellable = g_cancellable_new();
+	client->stream = listen_stream_new();
+	client->buf = g_malloc(BUF_SIZE);
+	client->idle_source = g_timeout_add_seconds(LISTEN_IDLE_TIMEOUT,
+			listen_client_idle, client);
+
+	PROBE1(accept, client);
+
+	g_input_stream_read_async(client->istream, client->buf, BUF_SIZE,
+			G_PRIORITY_DEFAULT, client->cancellable, listen_read_cb,
+			client);
+
+	return TRUE;
+}
+
+/* Parse input from listening sockets */
+static void listen_read_cb(GObject *source, GAsyncResult *result,
+		gpointer user_data)
+{
+	struct listen_client *client = user_data;
 	GError *error = NULL;
-	GInputStream *istream;
-	gchar *buf, **lines;
 	gssize len;
 
-	istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
-	buf = g_malloc0(BUF_SIZE);
-	len = g_input_stream_read(istream, buf, BUF_SIZE, NULL, &error);
-
+	len = g_input_stream_read_finish(G_INPUT_STREAM(source), result,
+			&error);
+	PROBE2(read, client, len);
 	if (len < 0) {
-		g_warning("Failed to read from client: %s", error->message);
+		/* cancelled by listen_client_idle() */
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning("Failed to read from client: %s",
+					error->message);
 		g_error_free(error);
-	} else if (len > 0) {
-		lines = g_strsplit(buf, "\r\n", 0);
-		for (guint i = 0; lines[i] != NULL; i++)
-			listen_parse(lines[i]);
-		g_strfreev(lines);
 	}
 
-	g_free(buf);
+	if (len <= 0) {
+		listen_stream_flush(client->stream);
+		listen_client_free(client);
+		return;
+	}
+
+	listen_stream_feed(client->stream, client->buf, len);
+
+	if (client->idle_source > 0)
+		g_source_remove(client->idle_source);
+	client->idle_source = g_timeout_add_seconds(LISTEN_IDLE_TIMEOUT,
+			listen_client_idle, client);
+	g_input_stream_read_async(client->istream, client->buf, BUF_SIZE,
+			G_PRIORITY_DEFAULT, client->cancellable, listen_read_cb,
+			client);
+}
+
+/* Stop waiting for an idle client, the pending read then finishes and
+ * closes the connection */
+static gboolean listen_client_idle(gpointer data)
+{
+	struct listen_client *client = data;
+
+	client->idle_source = 0;
+	g_cancellable_cancel(client->cancellable);
+	return FALSE;
+}
+
+/* close socket */
+static void listen_client_free(struct listen_client *client)
+{
+	if (client->idle_source > 0)
+		g_source_remove(client->idle_source);
+	listen_stream_free(client->stream);
+	g_object_unref(client->cancellable);
+	g_object_unref(client->connection);
+	g_free(client->buf);
+	g_slice_free(struct listen_client, client);
+	listen.clients--;
+}
+
+ListenStream *listen_stream_new(void)
+{
+	ListenStream *stream = g_slice_new(ListenStream);
+
+	stream->pending = g_string_sized_new(BUF_SIZE);
+	stream->mode = LISTEN_MODE_UNKNOWN;
+	stream->discarding = FALSE;
+	return stream;
+}
+
+/* Whether the pending line is JSON, before the mode is known the first
+ * line is checked the same way as in listen_stream_line() */
+static gboolean listen_stream_json(ListenStream *stream)
+{
+	const gchar *p = stream->pending->str;
+
+	if (stream->mode != LISTEN_MODE_UNKNOWN)
+		return stream->mode == LISTEN_MODE_JSON;
+
+	while (g_ascii_isspace(*p))
+		p++;
+	return *p == '{';
+}
+
+/* Forward every complete line, keep the rest until more data arrives */
+void listen_stream_feed(ListenStream *stream, const gchar *data, gsize len)
+{
+	const gchar *skip;
+	gchar *line, *end;
+	gsize done = 0;
+
+	if (stream->discarding) {
+		skip = memchr(data, '\n', len);
+		if (!skip)
+			return;
+		len -= skip - data + 1;
+		data = skip + 1;
+		stream->discarding = FALSE;
+	}
+
+	g_string_append_len(stream->pending, data, len);
+
+	line = stream->pending->str;
+	while ((end = memchr(line, '\n', stream->pending->len - done))) {
+		*end = '\0';
+		listen_stream_line(stream, line, end - line);
+		done += end - line + 1;
+		line = end + 1;
+	}
+	g_string_erase(stream->pending, 0, done);
+
+	if (!listen_stream_json(stream)) {
+		if (stream->pending->len >= LISTEN_LINE_MAX)
+			listen_stream_flush(stream);
+	} else if (stream->pending->len > LISTEN_JSON_MAX) {
+		g_message("Received JSON input longer than %d bytes, ignored",
+				LISTEN_JSON_MAX);
+		g_string_truncate(stream->pending, 0);
+		stream->discarding = TRUE;
+	}
+}
+
+void listen_stream_flush(ListenStream *stream)
+{
+	if (stream->pending->len > 0) {
+		listen_stream_line(stream, stream->pending->str,
+				stream->pending->len);
+		g_string_truncate(stream->pending, 0);
+	}
+}
+
+void listen_stream_free(ListenStream *stream)
+{
+	g_string_free(stream->pending, TRUE);
+	g_slice_free(ListenStream, stream);
+}
+
+static void listen_stream_line(ListenStream *stream, gchar *line,
+		gsize len)
+{
+	if (stream->mode == LISTEN_MODE_UNKNOWN) {
+		const gchar *p = line;
+
+		while (g_ascii_isspace(*p))
+			p++;
+		if (*p == '\0')
+			return;
+		stream->mode = *p == '{' ? LISTEN_MODE_JSON :
+			LISTEN_MODE_LINES;
+	}
+
+	if (stream->mode == LISTEN_MODE_JSON)
+		listen_parse_json(line, len);
+	else
+		listen_parse(line);
+}
+
+/* A channel name is sent to IRC as is, so it must not contain anything
+ * that ends the command or separates parameters */
+static gboolean listen_valid_channel(const gchar *channel)
+{
+	gsize len = strlen(channel);
+
+	if (channel[0] != '#' || len < 2 || len > LISTEN_CHANNEL_MAX)
+		return FALSE;
+
+	for (gsize i = 0; i < len; i++)
+		if ((guchar) channel[i] <= ' ' || channel[i] == ',' ||
+				channel[i] == 0x7f)
+			return FALSE;
 
-	/* close socket */
 	return TRUE;
 }
 
+/* Forward one input line.
+ * Format: "#channel [options --] text" or "* [options --] text", options
+ * are "!priority", "@+delay[smhd]" or "@HH:MM[:SS]" to deliver later and
+ * "~key", a message replaces the pending one with the same key. Options
+ * are only recognized when followed by "--", everything else is text.
+ * "* ~key --" without text cancels the pending message. */
 static void listen_parse(const gchar *input)
 {
-	gchar *line = g_strchomp(g_strdup(input));
+	NotifyPriority priority = PRIORITY_NORMAL, opt_priority;
+	const gchar *text, *p, *opt_key = NULL;
+	gchar *channel = NULL, *key = NULL;
+	gint64 delay = 0, opt_delay = 0;
+	gsize len, opt_key_len = 0;
 
-	if (line[0] != '#') {
-		if (line[0] != '*')
+	if (input[0] == '#') {
+		len = strcspn(input, " ");
+		channel = g_strndup(input, len);
+		text = &input[len];
+		if (!listen_valid_channel(channel)) {
+			g_message("Received input for an invalid channel,"
+					" ignored");
+			g_free(channel);
+			return;
+		}
+	} else if (input[0] == '*') {
+		text = &input[1];
+	} else {
+		text = input;
+		if (input[0] != '\0')
 			g_message("Received deprecated input format, the first"
 					" word should be the channel or *");
+	}
 
-		for (guint i = 0; prefs.irc_chans[i]; i++)
-			irc_say(prefs.irc_chans[i], line);
-		g_message("Forwarded data to IRC: %s", line);
+	while (g_ascii_isspace(*text))
+		text++;
+
+	/* options need the terminator, the deprecated format has none */
+	opt_priority = priority;
+	for (p = channel || input[0] == '*' ? text : ""; *p; ) {
+		len = strcspn(p, " \t");
+		if (len == 2 && strncmp(p, "--", 2) == 0) {
+			priority = opt_priority;
+			delay = opt_delay;
+			if (opt_key)
+				key = g_strndup(opt_key, opt_key_len);
+			text = &p[2];
+			break;
+		}
+
+		if (len < 2)
+			break;
+		if (p[0] == '!' &&
+				delivery_parse_priority(&p[1], len - 1,
+					&opt_priority))
+			;
+		else if (p[0] == '@' &&
+				listen_parse_delay(&p[1], len - 1, &opt_delay))
+			;
+		else if (p[0] == '~' && !opt_key) {
+			opt_key = &p[1];
+			opt_key_len = len - 1;
+		} else {
+			break;
+		}
+
+		p += len;
+		while (g_ascii_isspace(*p))
+			p++;
+	}
+
+	while (g_ascii_isspace(*text))
+		text++;
+	len = strlen(text);
+	while (len > 0 && g_ascii_isspace(text[len - 1]))
+		len--;
+
+	if (len > 0) {
+		listen_forward(channel, priority, delay, key, text, len);
+	} else if (key) {
+		if (timer_cancel(key))
+			g_message("Cancelled scheduled message %s", key);
+	}
+
+	g_free(channel);
+	g_free(key);
+}
+
+/* Forward one JSON object, e.g.
+ * {"channel":"#ops","severity":"crit","text":"...","key":"disk-sda"}
+ * "channel" must be a string and defaults to all channels, "delay" is in
+ * seconds, "at" takes the same values as the @ option and "cancel":true
+ * cancels "key" */
+static void listen_parse_json(gchar *line, gsize len)
+{
+	enum { CHANNEL, SEVERITY, TEXT, KEY, DELAY, AT, CANCEL };
+	JsonField fields[] = {
+		[CHANNEL] = { "channel", NULL, 0, FALSE },
+		[SEVERITY] = { "severity", NULL, 0, FALSE },
+		[TEXT] = { "text", NULL, 0, FALSE },
+		[KEY] = { "key", NULL, 0, FALSE },
+		[DELAY] = { "delay", NULL, 0, FALSE },
+		[AT] = { "at", NULL, 0, FALSE },
+		[CANCEL] = { "cancel", NULL, 0, FALSE }
+	};
+	NotifyPriority priority = PRIORITY_NORMAL;
+	const gchar *channel = NULL, *key = NULL, *text;
+	gchar number[32];
+	gint64 delay = 0;
+
+	if (len == strspn(line, " \t\r"))
+		return;
+
+	if (!json_scan(line, len, fields, G_N_ELEMENTS(fields))) {
+		g_message("Received malformed JSON input, ignored");
+		return;
+	}
+
+	if (fields[KEY].value && fields[KEY].string && fields[KEY].len > 0)
+		key = fields[KEY].value;
+
+	if (fields[CANCEL].value && !fields[CANCEL].string &&
+			fields[CANCEL].len == 4 &&
+			strncmp(fields[CANCEL].value, "true", 4) == 0) {
+		if (key && timer_cancel(key))
+			g_message("Cancelled scheduled message %s", key);
+		return;
+	}
+
+	/* a channel that is not a string must not turn into a broadcast */
+	if (fields[CHANNEL].value) {
+		if (!fields[CHANNEL].string ||
+				(strcmp(fields[CHANNEL].value, "*") != 0 &&
+				 !listen_valid_channel(fields[CHANNEL].value))) {
+			g_message("Received JSON input for an invalid channel,"
+					" ignored");
+			return;
+		}
+		if (strcmp(fields[CHANNEL].value, "*") != 0)
+			channel = fields[CHANNEL].value;
+	}
+
+	if (fields[SEVERITY].value && fields[SEVERITY].string)
+		delivery_parse_priority(fields[SEVERITY].value,
+				fields[SEVERITY].len, &priority);
+
+	if (fields[DELAY].value) {
+		gdouble seconds;
+		gchar *end;
+
+		if (fields[DELAY].string || fields[DELAY].len >= sizeof(number))
+			goto malformed;
+		memcpy(number, fields[DELAY].value, fields[DELAY].len);
+		number[fields[DELAY].len] = '\0';
+		seconds = g_ascii_strtod(number, &end);
+		if (*end != '\0' || !isfinite(seconds))
+			goto malformed;
+		delay = CLAMP(seconds, 0, G_MAXINT32) * G_USEC_PER_SEC;
+	} else if (fields[AT].value) {
+		if (!fields[AT].string || !listen_parse_delay(fields[AT].value,
+					fields[AT].len, &delay))
+			goto malformed;
+	}
+
+	if (!fields[TEXT].value || !fields[TEXT].string)
+		return;
+
+	text = fields[TEXT].value;
+	len = fields[TEXT].len;
+	while (len > 0 && g_ascii_isspace(text[len - 1]))
+		len--;
+
+	if (len > 0)
+		listen_forward(channel, priority, delay, key, text, len);
+	return;
+
+malformed:
+	g_message("Received JSON input with an invalid delay, ignored");
+}
+
+/* Parse "+N[smhd]" or the next occurrence of "HH:MM[:SS]" local time */
+static gboolean listen_parse_delay(const gchar *when, gsize len,
+		gint64 *delay)
+{
+	const gchar *p = when, *end = when + len;
+	guint fields[3] = { 0, 0, 0 }, n = 0;
+	GDateTime *now, *at, *tmp;
+
+	if (when[0] == '+') {
+		gchar *suffix;
+		guint64 seconds = g_ascii_strtoull(&when[1], &suffix, 10);
+		guint64 unit = 1;
+
+		if (suffix == &when[1] || suffix > end)
+			return FALSE;
+		if (suffix < end) {
+			switch (*suffix++) {
+			case 's': break;
+			case 'm': unit = 60; break;
+			case 'h': unit = 60 * 60; break;
+			case 'd': unit = 24 * 60 * 60; break;
+			default: return FALSE;
+			}
+		}
+		/* check before multiplying so large values cannot wrap */
+		if (suffix != end || seconds > G_MAXINT32 / unit)
+			return FALSE;
+
+		*delay = seconds * unit * G_USEC_PER_SEC;
+		return TRUE;
+	}
+
+	while (p < end && n < G_N_ELEMENTS(fields)) {
+		if (!g_ascii_isdigit(*p))
+			return FALSE;
+		for (guint i = 0; i < 2 && p < end && g_ascii_isdigit(*p); i++)
+			fields[n] = fields[n] * 10 + (*p++ - '0');
+		n++;
+		if (p < end && *p++ != ':')
+			return FALSE;
+	}
+	if (p != end || n < 2 || fields[0] > 23 || fields[1] > 59 ||
+			fields[2] > 59)
+		return FALSE;
+
+	now = g_date_time_new_now_local();
+	at = g_date_time_new_local(g_date_time_get_year(now),
+			g_date_time_get_month(now),
+			g_date_time_get_day_of_month(now),
+			fields[0], fields[1], fields[2]);
+	if (g_date_time_compare(at, now) <= 0) {
+		tmp = g_date_time_add_days(at, 1);
+		g_date_time_unref(at);
+		at = tmp;
+	}
+
+	*delay = g_date_time_difference(at, now);
+	g_date_time_unref(at);
+	g_date_time_unref(now);
+	return TRUE;
+}
+
+/* Deliver a message now or hand it to the timer wheel, the payload is
+ * copied once and shared between all channels it is delivered to */
+static void listen_forward(const gchar *channel, NotifyPriority priority,
+		gint64 delay, const gchar *key, const gchar *text, gsize len)
+{
+	struct listen_scheduled *scheduled;
+	NotifyMessage *msg;
+
+	/* the text is sent to IRC as is, a CR or other control character
+	 * must not end or alter the PRIVMSG */
+	msg = message_new(text, len);
+	for (gsize i = 0; i < msg->len; i++)
+		if ((guchar) msg->data[i] < ' ' || msg->data[i] == 0x7f)
+			msg->data[i] = ' ';
+	PROBE4(message_parsed, channel ? channel : "*", len, priority, delay);
+
+	if (delay > 0) {
+		scheduled = g_slice_new(struct listen_scheduled);
+		scheduled->channel = g_strdup(channel);
+		scheduled->priority = priority;
+		scheduled->msg = message_ref(msg);
+		timer_add(g_get_monotonic_time() + delay, key,
+				listen_scheduled_fire, scheduled,
+				listen_scheduled_free);
+		g_message("Scheduled data for IRC in %" G_GINT64_FORMAT "s: %s",
+				delay / G_USEC_PER_SEC, msg->data);
 	} else {
-		gushort i = strcspn(line," ");
-		gchar *channel = g_strndup(line, i);
-		irc_say(channel, &line[i]);
+		if (key)
+			timer_cancel(key);
+		listen_deliver(channel, priority, msg);
+	}
+
+	message_unref(msg);
+}
+
+/* Queue a message for one channel or, if channel is NULL, all channels */
+static void listen_deliver(const gchar *channel, NotifyPriority priority,
+		NotifyMessage *msg)
+{
+	if (channel) {
+		delivery_push(channel, msg, priority);
 		g_message("Forwarded data to IRC channel %s: %s", channel,
-				&line[i]);
-		g_free(channel);
+				msg->data);
+	} else {
+		for (guint i = 0; prefs.irc_chans[i]; i++)
+			delivery_push(prefs.irc_chans[i], msg, priority);
+		g_message("Forwarded data to IRC: %s", msg->data);
 	}
-	g_free(line);
+}
+
+static void listen_scheduled_fire(gpointer data)
+{
+	struct listen_scheduled *scheduled = data;
+
+	listen_deliver(scheduled->channel, scheduled->priority,
+			scheduled->msg);
+}
+
+static void listen_scheduled_free(gpointer data)
+{
+	struct listen_scheduled *scheduled = data;
+
+	message_unref(scheduled->msg);
+	g_free(scheduled->channel);
+	g_slice_free(struct listen_scheduled, scheduled);
 }
@@ -10,7 +10,18 @@
 
 #include <glib.h>
 
+typedef struct _ListenStream ListenStream;
+
 /* Initialize listeners, TCP and Unix domain sockets */
-gboolean	start_listener	(void);
+gboolean	start_listener		(void);
+
+/* Split a byte stream into lines and forward them */
+ListenStream	*listen_stream_new	(void);
+void		 listen_stream_feed	(ListenStream *stream,
+					 const gchar  *data,
+					 gsize         len);
+/* Forward a trailing line without a line break, e.g. at end of input */
+void		 listen_stream_flush	(ListenStream *stream);
+void		 listen_stream_free	(ListenStream *stream);
 
 #endif /* __LISTEN_H__ */
@@ -0,0 +1,42 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "message.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+#define MESSAGE_SIZE(len) (G_STRUCT_OFFSET(NotifyMessage, data) + (len) + 1)
+
+/* Allocate the header and payload in one slice so a message is one block */
+NotifyMessage *message_new(const gchar *data, gsize len)
+{
+	NotifyMessage *msg = g_slice_alloc(MESSAGE_SIZE(len));
+
+	msg->ref_count = 1;
+	msg->received = g_get_monotonic_time();
+	msg->len = len;
+	memcpy(msg->data, data, len);
+	msg->data[len] = '\0';
+
+	return msg;
+}
+
+NotifyMessage *message_ref(NotifyMessage *msg)
+{
+	g_atomic_int_inc(&msg->ref_count);
+	return msg;
+}
+
+void message_unref(NotifyMessage *msg)
+{
+	if (g_atomic_int_dec_and_test(&msg->ref_count))
+		g_slice_free1(MESSAGE_SIZE(msg->len), msg);
+}
@@ -0,0 +1,29 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __MESSAGE_H__
+#define __MESSAGE_H__
+
+#include <glib.h>
+
+/* Immutable message payload, shared by every delivery of the same line */
+typedef struct {
+	gint ref_count;
+	/* monotonic time the message was received */
+	gint64 received;
+	gsize len;
+	gchar data[];
+} NotifyMessage;
+
+/* Copy len bytes of data into a new message with a reference count of 1 */
+NotifyMessage	*message_new	(const gchar   *data,
+				 gsize          len);
+
+NotifyMessage	*message_ref	(NotifyMessage *msg);
+void		 message_unref	(NotifyMessage *msg);
+
+#endif /* __MESSAGE_H__ */
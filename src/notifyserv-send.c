@@ -0,0 +1,65 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnotifyserv.h"
+
+/* Send the arguments as one message, or every line read from stdin */
+int main(int argc, char *argv[])
+{
+	GError *error = NULL;
+	GOptionContext *context;
+	gchar *address = NULL, *channel = "*";
+	gchar line[4096];
+	gboolean ok = TRUE;
+	GOptionEntry entries[] = {
+		{ "address", 'a', 0, G_OPTION_ARG_STRING, &address,
+			"notifyserv address, a Unix domain socket path or "
+				"host[:port] (localhost by default)",
+			"address" },
+		{ "channel", 'c', 0, G_OPTION_ARG_STRING, &channel,
+			"Target channel (optional, * for all channels by "
+				"default)", "channel" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	context = g_option_context_new("[message] - send notifications to "
+			PACKAGE_NAME);
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+		exit(EXIT_FAILURE);
+	}
+	g_option_context_free(context);
+
+	if (!notifyserv_init(address))
+		exit(EXIT_FAILURE);
+
+	if (argc > 1) {
+		gchar *text = g_strjoinv(" ", &argv[1]);
+		ok = notify_send(channel, text);
+		g_free(text);
+	} else {
+		while (fgets(line, sizeof(line), stdin)) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (!notify_send(channel, line))
+				ok = FALSE;
+		}
+	}
+
+	notifyserv_close();
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
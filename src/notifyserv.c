@@ -15,10 +15,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "delivery.h"
 #include "irc.h"
 #include "listen.h"
 #include "log.h"
 #include "preferences.h"
+#include "tail.h"
+#include "timer.h"
 
 static void daemonize(void);
 static void cleanup(void);
@@ -100,12 +103,17 @@ void notify_shutdown(void)
 /* Cleanup handler, frees still used data */
 void cleanup(void)
 {
+	tail_cleanup();
+	timer_cleanup();
+	delivery_cleanup();
 	g_free(prefs.irc_ident);
 	g_free(prefs.irc_nick);
 	g_free(prefs.irc_server);
 	if (prefs.sock_path)
 		unlink(prefs.sock_path);
 	g_free(prefs.sock_path);
+	g_strfreev(prefs.tail_paths);
+	g_strfreev(prefs.channel_weights);
 }
 
 /* Signal handler function, called by sigaction for SIGINT, SIGTERM and SIGQUIT
@@ -0,0 +1,84 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "pacer.h"
+
+#include <glib.h>
+
+/* Lines that may be sent back to back */
+#define PACER_BURST 5.0
+/* Send rates in lines per second */
+#define PACER_RATE_INITIAL 1.0
+#define PACER_RATE_MIN 0.2
+#define PACER_RATE_MAX 5.0
+#define PACER_RATE_STEP 0.25
+/* Back off above, speed up below this lag */
+#define PACER_LAG_HIGH (2 * G_USEC_PER_SEC)
+#define PACER_LAG_LOW (G_USEC_PER_SEC / 2)
+
+static void pacer_refill(gint64 now);
+
+static struct {
+	gdouble rate;
+	gdouble tokens;
+	gint64 updated;
+} pacer;
+
+void pacer_reset(void)
+{
+	if (pacer.rate == 0)
+		pacer.rate = PACER_RATE_INITIAL;
+	pacer.tokens = PACER_BURST;
+	pacer.updated = g_get_monotonic_time();
+}
+
+static void pacer_refill(gint64 now)
+{
+	if (pacer.rate == 0)
+		pacer_reset();
+
+	pacer.tokens += (gdouble) (now - pacer.updated) * pacer.rate /
+		G_USEC_PER_SEC;
+	if (pacer.tokens > PACER_BURST)
+		pacer.tokens = PACER_BURST;
+	pacer.updated = now;
+}
+
+gint64 pacer_reserve(gint64 now)
+{
+	pacer_refill(now);
+
+	if (pacer.tokens >= 1.0) {
+		pacer.tokens -= 1.0;
+		return 0;
+	}
+
+	return (gint64) ((1.0 - pacer.tokens) / pacer.rate * G_USEC_PER_SEC)
+		+ 1;
+}
+
+/* Additive increase, multiplicative decrease */
+void pacer_update_lag(gint64 lag)
+{
+	gdouble rate;
+
+	pacer_refill(g_get_monotonic_time());
+
+	rate = pacer.rate;
+	if (lag > PACER_LAG_HIGH)
+		rate = MAX(rate / 2, PACER_RATE_MIN);
+	else if (lag < PACER_LAG_LOW)
+		rate = MIN(rate + PACER_RATE_STEP, PACER_RATE_MAX);
+
+	if (rate != pacer.rate) {
+		g_debug("[IRC] Lag is %.2fs, sending %.2f lines per second",
+				(gdouble) lag / G_USEC_PER_SEC, rate);
+		pacer.rate = rate;
+	}
+}
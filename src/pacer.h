@@ -0,0 +1,23 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <glib.h>
+
+/* Refill the burst, called when a new IRC connection is established */
+void	pacer_reset		(void);
+
+/* Take a token for one line, returns 0 when the line may be sent now or
+ * the number of microseconds until the next token is available */
+gint64	pacer_reserve		(gint64 now);
+
+/* Adapt the send rate to the measured server lag in microseconds */
+void	pacer_update_lag	(gint64 lag);
+
+#endif /* __PACER_H__ */
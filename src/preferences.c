@@ -22,7 +22,8 @@ void init_preferences(int argc, char *argv[])
 {
 	GError *error = NULL;
 	GOptionContext *context;
-	gchar **channels = NULL, *ident = PACKAGE;
+	gchar **channels = NULL, **tail = NULL, **weights = NULL;
+	gchar *ident = PACKAGE;
 	gchar *listen_address = "localhost", *nick = PACKAGE_NAME;
 	gchar *irc_server = NULL, *listen_path = NULL;
 	gboolean foreground = FALSE;
@@ -46,6 +47,9 @@ void init_preferences(int argc, char *argv[])
 			"(optional, 8675 by default)", "port" },
 		{ "irc-server", 's', 0, G_OPTION_ARG_STRING, &irc_server,
 			"IRC server, default port is 6667", "address[:port]" },
+		{ "tail", 't', 0, G_OPTION_ARG_FILENAME_ARRAY, &tail,
+			"Forward lines appended to a file or written to a named "
+				"pipe, may be given more than once", "path" },
 		{ "unix-path", 'u', 0, G_OPTION_ARG_FILENAME, &listen_path,
 			"Path to UNIX domain socket", "path" },
 		{ "verbose", 'v', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
@@ -53,6 +57,10 @@ void init_preferences(int argc, char *argv[])
 				"given more than once", NULL },
 		{ "version", 'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK,
 			print_version, "Print the version", NULL },
+		{ "weight", 'w', 0, G_OPTION_ARG_STRING_ARRAY, &weights,
+			"Relative share of a channel when several channels "
+				"have queued messages (optional, 1 by default), "
+				"may be given more than once", "channel=weight" },
 		{ NULL, 0, 0, 0, NULL, NULL, NULL }
 	};
 
@@ -80,6 +88,8 @@ void init_preferences(int argc, char *argv[])
 	prefs.bind_address = g_strdup(listen_address);
 	prefs.irc_nick = g_strdup(nick);
 	prefs.sock_path = g_strdup(listen_path);
+	prefs.tail_paths = g_strdupv(tail);
+	prefs.channel_weights = g_strdupv(weights);
 	prefs.fork = !foreground;
 	prefs.bind_port = port;
 }
@@ -12,12 +12,14 @@
 
 struct {
 	gboolean fork;
+	gchar **channel_weights;
 	gchar **irc_chans;
 	gchar *bind_address;
 	gchar *irc_ident;
 	gchar *irc_nick;
 	gchar *irc_server;
 	gchar *sock_path;
+	gchar **tail_paths;
 	guint irc_chanc;
 	guint16 bind_port;
 	guint16 irc_port;
@@ -0,0 +1,27 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/* Static USDT probes for the "notifyserv" provider. An inactive probe is a
+ * single nop, see contrib/bpftrace for scripts using them. Without
+ * sys/sdt.h they compile to nothing and their arguments are not evaluated */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(notifyserv, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(notifyserv, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(notifyserv, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(notifyserv, name, a, b, c, d)
+#else
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* __PROBES_H__ */
@@ -0,0 +1,302 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "tail.h"
+
+#include <glib.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "listen.h"
+#include "preferences.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define TAIL_CHUNK 65536
+#define TAIL_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define TAIL_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+struct tail_file {
+	gchar *path;
+	gchar *name;
+	gint fd;
+	/* inotify watches on the file and its directory */
+	gint wd;
+	gint dir_wd;
+	/* main loop source, only used for named pipes */
+	guint source;
+	ListenStream *stream;
+};
+
+static void tail_add(const gchar *path);
+static gboolean tail_open(struct tail_file *file, gboolean from_start);
+static void tail_close(struct tail_file *file);
+static void tail_read(struct tail_file *file);
+static gboolean tail_fifo_callback(GIOChannel *source,
+		GIOCondition condition, gpointer data);
+static gboolean tail_inotify_callback(GIOChannel *source,
+		GIOCondition condition, gpointer data);
+static void tail_event(const struct inotify_event *event);
+
+static struct {
+	gint inotify_fd;
+	guint inotify_source;
+	GSList *files;
+	gchar *buf;
+} tail = { -1, 0, NULL, NULL };
+
+/* Set up inotify and start following every configured path, returns
+ * FALSE if none of them can be followed */
+gboolean tail_start(void)
+{
+	GIOChannel *channel;
+
+	/* named pipes are still read without inotify */
+	tail.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (tail.inotify_fd < 0) {
+		g_warning("Failed to initialize inotify, only named pipes "
+				"can be read: %s", g_strerror(errno));
+	} else {
+		channel = g_io_channel_unix_new(tail.inotify_fd);
+		tail.inotify_source = g_io_add_watch(channel, G_IO_IN,
+				tail_inotify_callback, NULL);
+		g_io_channel_unref(channel);
+	}
+
+	tail.buf = g_malloc(TAIL_CHUNK);
+
+	for (guint i = 0; prefs.tail_paths[i]; i++)
+		tail_add(prefs.tail_paths[i]);
+
+	return tail.files != NULL;
+}
+
+/* Watch the directory for the file being (re)created and open it, new data
+ * is forwarded starting at the current end of the file */
+static void tail_add(const gchar *path)
+{
+	struct tail_file *file;
+	gchar *dir;
+
+	file = g_slice_new0(struct tail_file);
+	file->path = g_strdup(path);
+	file->name = g_path_get_basename(path);
+	file->fd = file->wd = -1;
+	file->stream = listen_stream_new();
+
+	if (tail.inotify_fd >= 0) {
+		dir = g_path_get_dirname(path);
+		file->dir_wd = inotify_add_watch(tail.inotify_fd, dir,
+				TAIL_DIR_EVENTS);
+		if (file->dir_wd < 0)
+			g_warning("Failed to watch directory %s: %s", dir,
+					g_strerror(errno));
+		g_free(dir);
+	}
+
+	if (!tail_open(file, FALSE) && file->dir_wd < 0) {
+		listen_stream_free(file->stream);
+		g_free(file->name);
+		g_free(file->path);
+		g_slice_free(struct tail_file, file);
+		return;
+	}
+
+	tail.files = g_slist_prepend(tail.files, file);
+}
+
+static gboolean tail_open(struct tail_file *file, gboolean from_start)
+{
+	struct stat st;
+
+	if (stat(file->path, &st) < 0) {
+		if (errno != ENOENT)
+			g_warning("Failed to stat %s: %s", file->path,
+					g_strerror(errno));
+		return FALSE;
+	}
+
+	/* a FIFO opened for writing as well never reports end of file when
+	 * the last writer goes away */
+	if (!S_ISFIFO(st.st_mode) && tail.inotify_fd < 0) {
+		g_warning("Cannot follow %s without inotify", file->path);
+		return FALSE;
+	}
+
+	file->fd = open(file->path, (S_ISFIFO(st.st_mode) ? O_RDWR : O_RDONLY)
+			| O_NONBLOCK | O_CLOEXEC);
+	if (file->fd < 0) {
+		g_warning("Failed to open %s: %s", file->path,
+				g_strerror(errno));
+		return FALSE;
+	}
+
+	if (S_ISFIFO(st.st_mode)) {
+		GIOChannel *channel = g_io_channel_unix_new(file->fd);
+		file->source = g_io_add_watch(channel, G_IO_IN,
+				tail_fifo_callback, file);
+		g_io_channel_unref(channel);
+		g_message("Reading from named pipe %s", file->path);
+		return TRUE;
+	}
+
+	file->wd = inotify_add_watch(tail.inotify_fd, file->path,
+			TAIL_FILE_EVENTS);
+	if (file->wd < 0) {
+		g_warning("Failed to watch %s: %s", file->path,
+				g_strerror(errno));
+		tail_close(file);
+		return FALSE;
+	}
+
+	if (!from_start)
+		lseek(file->fd, 0, SEEK_END);
+	else
+		tail_read(file);
+
+	g_message("Following %s", file->path);
+	return TRUE;
+}
+
+/* Forward what is left and stop following the current file */
+static void tail_close(struct tail_file *file)
+{
+	if (file->fd < 0)
+		return;
+
+	if (file->source > 0) {
+		g_source_remove(file->source);
+		file->source = 0;
+	}
+	if (file->wd >= 0) {
+		inotify_rm_watch(tail.inotify_fd, file->wd);
+		file->wd = -1;
+	}
+
+	listen_stream_flush(file->stream);
+	close(file->fd);
+	file->fd = -1;
+}
+
+/* Read everything that is available in large chunks */
+static void tail_read(struct tail_file *file)
+{
+	struct stat st;
+	gssize len;
+
+	/* the file was truncated, start over */
+	if (fstat(file->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+			st.st_size < lseek(file->fd, 0, SEEK_CUR)) {
+		g_message("%s was truncated", file->path);
+		listen_stream_flush(file->stream);
+		lseek(file->fd, 0, SEEK_SET);
+	}
+
+	while ((len = read(file->fd, tail.buf, TAIL_CHUNK)) > 0)
+		listen_stream_feed(file->stream, tail.buf, len);
+
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		g_warning("Failed to read from %s: %s", file->path,
+				g_strerror(errno));
+}
+
+static gboolean tail_fifo_callback(G_GNUC_UNUSED GIOChannel *source,
+		G_GNUC_UNUSED GIOCondition condition, gpointer data)
+{
+	tail_read(data);
+	return TRUE;
+}
+
+static gboolean tail_inotify_callback(G_GNUC_UNUSED GIOChannel *source,
+		G_GNUC_UNUSED GIOCondition condition,
+		G_GNUC_UNUSED gpointer data)
+{
+	gchar buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	gssize len;
+
+	while ((len = read(tail.inotify_fd, buf, sizeof(buf))) > 0) {
+		for (gchar *p = buf; p < buf + len;
+				p += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *) p;
+			tail_event(event);
+		}
+	}
+
+	return TRUE;
+}
+
+static void tail_event(const struct inotify_event *event)
+{
+	for (GSList *l = tail.files; l; l = l->next) {
+		struct tail_file *file = l->data;
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			if (file->fd >= 0)
+				tail_read(file);
+		} else if (event->wd == file->wd && file->fd >= 0) {
+			tail_read(file);
+			/* rotated away, wait for it to be recreated */
+			if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+				tail_close(file);
+		} else if (event->wd == file->dir_wd && event->len > 0 &&
+				strcmp(event->name, file->name) == 0) {
+			if (file->fd >= 0) {
+				tail_read(file);
+				tail_close(file);
+			}
+			tail_open(file, TRUE);
+		}
+	}
+}
+
+void tail_cleanup(void)
+{
+	for (GSList *l = tail.files; l; l = l->next) {
+		struct tail_file *file = l->data;
+
+		tail_close(file);
+		listen_stream_free(file->stream);
+		g_free(file->name);
+		g_free(file->path);
+		g_slice_free(struct tail_file, file);
+	}
+	g_slist_free(tail.files);
+	tail.files = NULL;
+
+	if (tail.inotify_source > 0)
+		g_source_remove(tail.inotify_source);
+	if (tail.inotify_fd >= 0)
+		close(tail.inotify_fd);
+	g_free(tail.buf);
+}
+
+#else /* HAVE_SYS_INOTIFY_H */
+
+gboolean tail_start(void)
+{
+	g_warning("Following files is not supported on this system");
+	return FALSE;
+}
+
+void tail_cleanup(void)
+{
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
@@ -0,0 +1,17 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __TAIL_H__
+#define __TAIL_H__
+
+#include <glib.h>
+
+/* Follow the files and named pipes given with -t */
+gboolean	tail_start	(void);
+void		tail_cleanup	(void);
+
+#endif /* __TAIL_H__ */
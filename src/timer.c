@@ -0,0 +1,227 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#include "config.h"
+
+#include "timer.h"
+
+#include <glib.h>
+
+/* Hierarchical timer wheel: level 0 has one slot per tick, every slot of
+ * a higher level covers a whole turn of the level below and is cascaded
+ * down when its turn comes. Adding and cancelling are O(1), four levels
+ * of 64 one second slots cover 194 days, later timers are parked in the
+ * last level and placed again each time they are cascaded */
+#define TIMER_TICK G_USEC_PER_SEC
+#define TIMER_BITS 6
+#define TIMER_SIZE (1 << TIMER_BITS)
+#define TIMER_MASK (TIMER_SIZE - 1)
+#define TIMER_LEVELS 4
+#define TIMER_RANGE ((guint64) 1 << (TIMER_BITS * TIMER_LEVELS))
+
+struct timer_entry {
+	struct timer_entry *next;
+	struct timer_entry *prev;
+	struct timer_entry **slot;
+	/* in ticks */
+	guint64 expires;
+	gchar *key;
+	TimerFunc func;
+	gpointer data;
+	GDestroyNotify destroy;
+};
+
+static guint64 timer_ticks(gint64 time);
+static void timer_link(struct timer_entry *entry);
+static void timer_unlink(struct timer_entry *entry);
+static void timer_free(struct timer_entry *entry);
+static void timer_cascade(guint level);
+static gboolean timer_tick(gpointer user_data);
+
+static struct {
+	struct timer_entry *slots[TIMER_LEVELS][TIMER_SIZE];
+	/* the last tick that was processed */
+	guint64 now;
+	gint64 base;
+	guint count;
+	guint source;
+	GHashTable *keys;
+} timer;
+
+/* Convert a monotonic time to ticks, rounding up */
+static guint64 timer_ticks(gint64 time)
+{
+	if (timer.base == 0)
+		timer.base = g_get_monotonic_time();
+	if (time <= timer.base)
+		return 0;
+
+	return (time - timer.base + TIMER_TICK - 1) / TIMER_TICK;
+}
+
+void timer_add(gint64 expires, const gchar *key, TimerFunc func,
+		gpointer data, GDestroyNotify destroy)
+{
+	struct timer_entry *entry;
+
+	if (key)
+		timer_cancel(key);
+
+	/* nothing was advanced while the wheel was empty */
+	if (timer.count == 0)
+		timer.now = timer_ticks(g_get_monotonic_time());
+
+	entry = g_slice_new(struct timer_entry);
+	entry->expires = MAX(timer_ticks(expires), timer.now + 1);
+	entry->key = g_strdup(key);
+	entry->func = func;
+	entry->data = data;
+	entry->destroy = destroy;
+
+	timer_link(entry);
+	timer.count++;
+
+	if (key) {
+		if (!timer.keys)
+			timer.keys = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(timer.keys, entry->key, entry);
+	}
+
+	if (timer.source == 0)
+		timer.source = g_timeout_add_seconds(1, timer_tick, NULL);
+}
+
+gboolean timer_cancel(const gchar *key)
+{
+	struct timer_entry *entry;
+
+	if (!timer.keys || !(entry = g_hash_table_lookup(timer.keys, key)))
+		return FALSE;
+
+	timer_unlink(entry);
+	timer_free(entry);
+	return TRUE;
+}
+
+/* Put an entry into the slot of the lowest level that reaches its expiry */
+static void timer_link(struct timer_entry *entry)
+{
+	struct timer_entry **slot;
+	guint64 expires = entry->expires;
+	guint level;
+
+	if (expires - timer.now >= TIMER_RANGE)
+		expires = timer.now + TIMER_RANGE - 1;
+
+	for (level = 0; level < TIMER_LEVELS - 1; level++)
+		if (expires - timer.now <
+				(guint64) 1 << (TIMER_BITS * (level + 1)))
+			break;
+
+	slot = &timer.slots[level][(expires >> (TIMER_BITS * level)) &
+		TIMER_MASK];
+	entry->slot = slot;
+	entry->prev = NULL;
+	entry->next = *slot;
+	if (*slot)
+		(*slot)->prev = entry;
+	*slot = entry;
+}
+
+/* Take an entry off the wheel, its key is free to be used again */
+static void timer_unlink(struct timer_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		*entry->slot = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+
+	if (entry->key)
+		g_hash_table_remove(timer.keys, entry->key);
+	timer.count--;
+}
+
+static void timer_free(struct timer_entry *entry)
+{
+	if (entry->destroy)
+		entry->destroy(entry->data);
+	g_free(entry->key);
+	g_slice_free(struct timer_entry, entry);
+}
+
+/* Move the current slot of a level down to the levels below */
+static void timer_cascade(guint level)
+{
+	struct timer_entry **slot, *entry, *next;
+
+	slot = &timer.slots[level][(timer.now >> (TIMER_BITS * level)) &
+		TIMER_MASK];
+	entry = *slot;
+	*slot = NULL;
+
+	for (; entry; entry = next) {
+		next = entry->next;
+		timer_link(entry);
+	}
+}
+
+/* Advance the wheel to the current time and run what has expired */
+static gboolean timer_tick(G_GNUC_UNUSED gpointer user_data)
+{
+	struct timer_entry **slot, *entry;
+	guint64 target = timer_ticks(g_get_monotonic_time());
+
+	while (timer.count > 0 && timer.now < target) {
+		timer.now++;
+
+		for (guint level = 1; level < TIMER_LEVELS; level++) {
+			if ((timer.now >> (TIMER_BITS * (level - 1))) &
+					TIMER_MASK)
+				break;
+			timer_cascade(level);
+		}
+
+		slot = &timer.slots[0][timer.now & TIMER_MASK];
+		while ((entry = *slot)) {
+			timer_unlink(entry);
+			entry->func(entry->data);
+			timer_free(entry);
+		}
+	}
+
+	if (timer.count > 0)
+		return TRUE;
+
+	timer.source = 0;
+	return FALSE;
+}
+
+void timer_cleanup(void)
+{
+	struct timer_entry *entry;
+
+	if (timer.source > 0) {
+		g_source_remove(timer.source);
+		timer.source = 0;
+	}
+
+	for (guint level = 0; level < TIMER_LEVELS; level++) {
+		for (guint i = 0; i < TIMER_SIZE; i++) {
+			while ((entry = timer.slots[level][i])) {
+				timer_unlink(entry);
+				timer_free(entry);
+			}
+		}
+	}
+
+	if (timer.keys) {
+		g_hash_table_destroy(timer.keys);
+		timer.keys = NULL;
+	}
+}
@@ -0,0 +1,30 @@
+/*
+ * IRC notification system
+ *
+ * Copyright (c) 2008-2011, Christoph Mende <mende.christoph@gmail.com>
+ * All rights reserved. Released under the 2-clause BSD license.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <glib.h>
+
+typedef void (*TimerFunc) (gpointer data);
+
+/* Call func(data) once the monotonic time reaches expires, with a
+ * resolution of one second. A pending timer with the same key is
+ * cancelled first, key may be NULL. destroy is called on data when the
+ * timer has fired or was cancelled */
+void		timer_add	(gint64          expires,
+				 const gchar    *key,
+				 TimerFunc       func,
+				 gpointer        data,
+				 GDestroyNotify  destroy);
+
+/* Cancel the pending timer with this key, returns FALSE if there is none */
+gboolean	timer_cancel	(const gchar    *key);
+
+void		timer_cleanup	(void);
+
+#endif /* __TIMER_H__ */